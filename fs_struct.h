@@ -7,6 +7,9 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define FS_SIZE (1024 * 1024)  // 1 mb
 #define BLOCK_SIZE 512
@@ -16,6 +19,15 @@
 #define MAX_FILES 128
 #define FAT_EOF -1
 #define FREE_BLOCK 0
+#define NO_BLOCK 0  // nodo senza blocco fisico associato (buco di un blocco, i valori negativi -n indicano un buco di n blocchi)
+#define HASH_BUCKETS 256
+#define NOT_INDEXED -2  // blocco non presente nell'indice di deduplicazione
+#define FS_MAGIC 0x46415431
+#define FS_VERSION 4
+#define MAX_SNAPSHOTS 2
+#define PENDING_MAX (64 * BLOCK_SIZE)  // dati accodati tenuti nel buffer dell'handle prima del flush
+#define MAX_WORKERS 8  // thread usati per visitare l'albero delle directory
+#define WALK_PATH_MAX 256
 
 typedef struct {
     char name[16];
@@ -29,10 +41,50 @@ typedef struct {
     int next_block;
 } FATEntry;
 
+typedef struct {
+    char name[16];
+    int is_used;
+    uint32_t checksum;  // CRC32C della copia salvata nello slot
+} SnapshotInfo;
+
+// metadati dei blocchi fisici, salvati in coda all'immagine
+// i nodi della FAT formano la catena del file, block_map associa ad ogni nodo il blocco fisico
+// che contiene i dati: in questo modo più nodi (anche di file diversi) possono condividere lo stesso blocco
+typedef struct {
+    int magic;
+    int version;
+    uint32_t meta_checksum;  // CRC32C dei campi seguenti, aggiornato dopo ogni comando
+    int dedup;  // deduplicazione inline attiva
+    int verify;  // verifica dei checksum ad ogni lettura
+    SnapshotInfo snapshots[MAX_SNAPSHOTS];
+    int block_map[FAT_ENTRIES];  // nodo FAT -> blocco fisico (<= NO_BLOCK per i buchi dei file sparsi)
+    int ref_count[BLOCK_ENTRIES];  // numero di nodi che puntano al blocco
+    uint32_t checksum[BLOCK_ENTRIES];  // CRC32C di ogni blocco (dati e zona FAT/directory), usato anche come hash dell'indice
+    int hash_next[BLOCK_ENTRIES];  // blocco successivo nello stesso bucket (-1 fine, NOT_INDEXED se assente)
+    int hash_head[HASH_BUCKETS];
+} BlockMeta;
+
+// snapshot in sola lettura: copia della zona indirizzata dalla FAT (FAT, root e directory) e della mappa dei nodi,
+// i blocchi dati restano condivisi con il file system attivo tramite i reference count
+typedef struct {
+    char zone[FAT_ENTRIES * BLOCK_SIZE];
+    int block_map[FAT_ENTRIES];
+} Snapshot;
+
+#define META_BLOCKS ((int)((sizeof(BlockMeta) + BLOCK_SIZE - 1) / BLOCK_SIZE))
+#define META_START (BLOCK_ENTRIES - META_BLOCKS)
+#define SNAPSHOT_BLOCKS ((int)((sizeof(Snapshot) + BLOCK_SIZE - 1) / BLOCK_SIZE))
+#define SNAPSHOT_START (META_START - MAX_SNAPSHOTS * SNAPSHOT_BLOCKS)
+#define POOL_START FAT_ENTRIES  // i blocchi sotto FAT_ENTRIES sono indirizzati direttamente dalla FAT (directory)
+#define POOL_END SNAPSHOT_START
+
 typedef struct {
     int index;
     int file_pos;  // position in file
     int block_pos;  // position in block
+    char *pending;  // dati accodati in attesa di allocazione (allocazione ritardata)
+    int pending_len;
+    int pending_pos;  // posizione nel file del primo byte in attesa
 } FileHandle;
 
 typedef struct {
@@ -40,19 +92,73 @@ typedef struct {
     FileEntry *current_dir;
     FileEntry *root; 
     FATEntry *fat;   // file allocation table
-    void *buffer_fs;  // buffer sul quale mappare i dati
+    void *buffer_fs;  // buffer sul quale mappare i dati (punta alla copia dello snapshot se ne è montato uno)
+    void *image_fs;  // immagine mappata, contiene sempre i blocchi dati dei file
+    BlockMeta *meta;  // metadati dei blocchi dati (reference count, checksum, indice hash, snapshot)
+    int *block_map;  // mappa nodo FAT -> blocco fisico della vista corrente
+    int read_only;  // vero se è montato uno snapshot
+    unsigned char zone_ok[POOL_START];  // blocchi della zona FAT integri all'inizio del comando corrente
+    int meta_ok;  // metadati dei blocchi integri all'inizio del comando corrente
 } FileSystem;
 
+// visita parallela dell'albero: ogni directory da esaminare è un elemento di lavoro, ogni worker ha una deque
+// da cui prende in fondo (LIFO) e da cui gli altri worker rubano in cima quando restano senza lavoro
+typedef struct {
+    int block;  // blocco dati della directory
+    char path[WALK_PATH_MAX];
+} WalkItem;
+
+typedef struct {
+    int items[FAT_ENTRIES];  // indici in Walker.items, ogni directory viene inserita una volta sola
+    int top, bottom;
+    pthread_mutex_t lock;
+} WorkDeque;
+
+typedef struct Walker Walker;
+typedef void (*VisitFn)(Walker *w, int worker, FileEntry *entry, const char *path);
+
+struct Walker {
+    FileSystem *fs;
+    VisitFn visit;  // chiamata per ogni entry trovata (file e directory)
+    void *ctx;  // stato dell'operazione (du, find, rm -r)
+    WalkItem *items;
+    atomic_int item_count;
+    atomic_int pending;  // directory in coda o in elaborazione
+    int workers;
+    WorkDeque deques[MAX_WORKERS];
+};
+
 int createFile(FileSystem *fs, const char *name, int file_size);
 int eraseFile(FileSystem *fs, const char *name);
 int createDir(FileSystem *fs, const char *name);
 int eraseDir(FileSystem *fs, const char *name);
 int changeDir(FileSystem *fs, const char *dir);
 void listDir(FileSystem *fs);
+void walkTree(FileSystem *fs, int dir_block, const char *path, VisitFn visit, void *ctx);
+int eraseTree(FileSystem *fs, const char *name);
+void diskUsage(FileSystem *fs, const char *name);
+void findEntries(FileSystem *fs, const char *pattern);
 void processCommand(FileSystem *fs, const char *input);
 void cleanup(FileSystem *fs);
+void formatFS(FileSystem *fs);
+int allocNode(FileSystem *fs);
+int allocBlock(FileSystem *fs);
+void releaseBlock(FileSystem *fs, int block);
+uint32_t crc32c(const void *data, size_t len);
+void checkMetadata(FileSystem *fs);
+void syncChecksums(FileSystem *fs);
+int verifyFS(FileSystem *fs);
+uint32_t snapshotChecksum(FileSystem *fs, int slot);
+int flushFile(FileSystem *fs, FileHandle *fh);
+int fallocateFile(FileSystem *fs, const char *name, int offset, int length);
+int truncateFile(FileSystem *fs, const char *name, int size);
+int cloneFile(FileSystem *fs, const char *src, const char *dst, int reflink);
+int createSnapshot(FileSystem *fs, const char *name);
+int eraseSnapshot(FileSystem *fs, const char *name);
+int mountSnapshot(FileSystem *fs, const char *name);
+void unmountSnapshot(FileSystem *fs);
 
-FileHandle current_open_file = { .index = -1, .file_pos = 0, .block_pos = 0 };
+FileHandle current_open_file = { .index = -1, .file_pos = 0, .block_pos = 0, .pending = NULL, .pending_len = 0, .pending_pos = 0 };
 
 // TO IMPLEMENT:
 // write (potentially extending the file boundaries)
@@ -4,6 +4,13 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <limits.h>
+#include <stddef.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 #include "fs_struct.h"
 
 // creazione nuovo file nella directory corrente
@@ -56,6 +63,20 @@ int createFile(FileSystem *fs, const char *name, int file_size) {
     return -1;
 }
 
+// libera una catena di nodi a partire da node, lasciando i riferimenti ai blocchi fisici
+void freeChain(FileSystem *fs, int node) {
+    while (node != FAT_EOF) {
+        int next_node = fs->fat[node].next_block;
+        fs->fat[node].next_block = FREE_BLOCK;
+
+        if (fs->block_map[node] > NO_BLOCK)
+            releaseBlock(fs, fs->block_map[node]);
+        fs->block_map[node] = NO_BLOCK;
+
+        node = next_node;
+    }
+}
+
 // elimina un file dalla directory corrente
 int eraseFile(FileSystem* fs, const char *name) {
     // trova il file nella directory
@@ -76,19 +97,8 @@ int eraseFile(FileSystem* fs, const char *name) {
         return -1;
     }
     
-    // libera i blocchi nella FAT
-    int block = fs->current_dir[file_index].start_block;
-    while (block != FAT_EOF) {
-        int next_block = fs->fat[block].next_block;
-        fs->fat[block].next_block = FREE_BLOCK;
-        
-        // calcola l'offset per la FAT entry
-        int fat_offset = (block * sizeof(FATEntry)) % BLOCK_SIZE;
-        FATEntry *fat_entry = (FATEntry *)(fs->buffer_fs + (block / (BLOCK_SIZE / sizeof(FATEntry))) * BLOCK_SIZE + fat_offset);
-        memset(fat_entry, 0, sizeof(FATEntry));
-        
-        block = next_block;
-    }
+    // libera i nodi nella FAT: i blocchi fisici vengono rilasciati solo quando non sono più condivisi
+    freeChain(fs, fs->current_dir[file_index].start_block);
 
     // cancella l'entry del file
     memset(&fs->current_dir[file_index], 0, sizeof(FileEntry));
@@ -103,10 +113,10 @@ int getBlockFromPtr(FileSystem *fs, FileEntry *dir_ptr) {
     return offset / BLOCK_SIZE;
 }
 int findFreeDataBlockInBuffer(FileSystem *fs) {
-    for (int data_block = 10; data_block < BLOCK_ENTRIES; data_block++) {  // i primi 10 blocchi del file system sono riservati per la FAT e la root directory
+    for (int data_block = 10; data_block < FAT_ENTRIES; data_block++) {  // i primi 10 blocchi del file system sono riservati per la FAT e la root directory
         if (fs->fat[data_block].next_block == FREE_BLOCK) {
             // trova un blocco libero
-            for (int fat_index = 0; fat_index < BLOCK_ENTRIES; fat_index++) {
+            for (int fat_index = 0; fat_index < FAT_ENTRIES; fat_index++) {
                 if (fs->fat[fat_index].next_block == 0 && fat_index != data_block) {
                     fs->fat[fat_index].next_block = data_block;
                     fs->fat[data_block].next_block = FAT_EOF;
@@ -121,6 +131,257 @@ int findFreeDataBlockInBuffer(FileSystem *fs) {
     return -1;
 }
 
+// alloca un nodo della catena FAT per i dati di un file, ancora senza blocco fisico
+int allocNode(FileSystem *fs) {
+    for (int node = 0; node < FAT_ENTRIES; node++) {
+        if (fs->fat[node].next_block == FREE_BLOCK) {
+            fs->fat[node].next_block = FAT_EOF;
+            fs->block_map[node] = NO_BLOCK;
+            return node;
+        }
+    }
+    printf("No free FAT entry found.\n");
+    return -1;
+}
+
+// restituisce il nodo successivo della catena, accodandone uno nuovo alla fine del file
+int nextNode(FileSystem *fs, int node) {
+    if (fs->fat[node].next_block != FAT_EOF)
+        return fs->fat[node].next_block;
+
+    int new_node = allocNode(fs);
+    if (new_node == -1)
+        return -1;
+    fs->fat[node].next_block = new_node;
+    return new_node;
+}
+
+// numero di blocchi logici coperti da un nodo: uno se ha un blocco fisico, la lunghezza del buco altrimenti
+int nodeSpan(FileSystem *fs, int node) {
+    return fs->block_map[node] < NO_BLOCK ? -fs->block_map[node] : 1;
+}
+
+// divide un buco in modo che il blocco in posizione offset abbia un nodo proprio:
+// [buco offset] [nodo] [buco span - offset - 1], i nodi necessari vengono allocati prima di modificare la catena
+int splitHole(FileSystem *fs, int node, int offset) {
+    int span = nodeSpan(fs, node);
+    if (span == 1)
+        return node;
+
+    int after = span - offset - 1;
+    int tail = -1, target = node;
+    if (after > 0 && (tail = allocNode(fs)) == -1)
+        return -1;
+    if (offset > 0 && (target = allocNode(fs)) == -1) {
+        if (tail != -1)
+            fs->fat[tail].next_block = FREE_BLOCK;
+        return -1;
+    }
+
+    if (tail != -1) {
+        fs->fat[tail].next_block = fs->fat[node].next_block;
+        fs->fat[node].next_block = tail;
+        fs->block_map[tail] = -after;
+    }
+    if (target != node) {
+        fs->fat[target].next_block = fs->fat[node].next_block;
+        fs->fat[node].next_block = target;
+        fs->block_map[node] = -offset;
+    }
+    fs->block_map[target] = NO_BLOCK;
+    return target;
+}
+
+// restituisce il nodo che copre esattamente il blocco logico index del file: se il file è più corto
+// il tratto mancante diventa un unico nodo buco, senza allocare blocchi fisici
+int seekNode(FileSystem *fs, int header, int index) {
+    int prev = header;
+    int node = fs->fat[header].next_block;
+    int pos = 0;
+    while (node != FAT_EOF && pos + nodeSpan(fs, node) <= index) {
+        pos += nodeSpan(fs, node);
+        prev = node;
+        node = fs->fat[node].next_block;
+    }
+
+    if (node == FAT_EOF) {
+        if (index > pos) {
+            int hole = nextNode(fs, prev);
+            if (hole == -1)
+                return -1;
+            fs->block_map[hole] = -(index - pos);
+            prev = hole;
+        }
+        return nextNode(fs, prev);
+    }
+    return splitHole(fs, node, index - pos);
+}
+
+// alloca un blocco fisico libero nella zona dati dei file
+int allocBlock(FileSystem *fs) {
+    for (int block = POOL_START; block < POOL_END; block++) {
+        if (fs->meta->ref_count[block] == 0) {
+            fs->meta->ref_count[block] = 1;
+            fs->meta->hash_next[block] = NOT_INDEXED;
+            return block;
+        }
+    }
+    printf("No free data block found.\n");
+    return -1;
+}
+
+// CRC32C (polinomio di Castagnoli, riflesso): con SSE4.2 si usa l'istruzione crc32, altrimenti una tabella
+static uint32_t crc_table[256];
+static uint32_t zero_block_crc;  // checksum di un blocco azzerato, usato per i blocchi appena allocati
+
+static uint32_t crc32cTable(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t) = crc32cTable;
+
+// sceglie l'implementazione del CRC32C in base alla CPU e prepara la tabella
+void initChecksums(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+        crc_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32cHw;
+#endif
+    char zero[BLOCK_SIZE] = { 0 };
+    zero_block_crc = crc32c(zero, BLOCK_SIZE);
+}
+
+uint32_t crc32c(const void *data, size_t len) {
+    return ~crc32c_impl(~0u, (const unsigned char *)data, len);
+}
+
+// il checksum del contenuto fa anche da hash per la deduplicazione
+uint32_t hashBlock(const void *data) {
+    return crc32c(data, BLOCK_SIZE);
+}
+
+// ricalcola il checksum di un blocco dopo averne modificato il contenuto
+void updateChecksum(FileSystem *fs, int block) {
+    fs->meta->checksum[block] = crc32c(fs->image_fs + block * BLOCK_SIZE, BLOCK_SIZE);
+}
+
+// con la verifica attiva controlla che il contenuto di un blocco corrisponda al suo checksum prima di usarlo
+int blockCorrupted(FileSystem *fs, int block) {
+    return fs->meta->verify && crc32c(fs->image_fs + block * BLOCK_SIZE, BLOCK_SIZE) != fs->meta->checksum[block];
+}
+
+// inserisce un blocco nell'indice hash -> blocco (il suo checksum deve essere aggiornato)
+void indexBlock(FileSystem *fs, int block) {
+    if (fs->meta->hash_next[block] != NOT_INDEXED)
+        return;
+    int bucket = fs->meta->checksum[block] % HASH_BUCKETS;
+    fs->meta->hash_next[block] = fs->meta->hash_head[bucket];
+    fs->meta->hash_head[bucket] = block;
+}
+
+// rimuove un blocco dall'indice (va fatto prima di modificarne il contenuto)
+void unindexBlock(FileSystem *fs, int block) {
+    if (fs->meta->hash_next[block] == NOT_INDEXED)
+        return;
+    int *link = &fs->meta->hash_head[fs->meta->checksum[block] % HASH_BUCKETS];
+    while (*link != block)
+        link = &fs->meta->hash_next[*link];
+    *link = fs->meta->hash_next[block];
+    fs->meta->hash_next[block] = NOT_INDEXED;
+}
+
+// cerca nell'indice un blocco con lo stesso contenuto di data
+int findDuplicate(FileSystem *fs, const void *data, uint32_t hash) {
+    for (int block = fs->meta->hash_head[hash % HASH_BUCKETS]; block != -1; block = fs->meta->hash_next[block]) {
+        if (fs->meta->checksum[block] == hash && memcmp(fs->image_fs + block * BLOCK_SIZE, data, BLOCK_SIZE) == 0)
+            return block;
+    }
+    return -1;
+}
+
+// lascia un riferimento al blocco fisico, che torna libero quando nessun nodo lo usa più
+void releaseBlock(FileSystem *fs, int block) {
+    if (--fs->meta->ref_count[block] == 0)
+        unindexBlock(fs, block);
+}
+
+// fa puntare il nodo ad un blocco già esistente, rilasciando quello precedente
+void shareBlock(FileSystem *fs, int node, int block) {
+    int old_block = fs->block_map[node];
+    if (old_block == block)
+        return;
+    fs->meta->ref_count[block]++;
+    fs->block_map[node] = block;
+    if (old_block > NO_BLOCK)
+        releaseBlock(fs, old_block);
+}
+
+// restituisce un blocco fisico modificabile per il nodo: lo alloca se manca e lo copia se è condiviso
+int writableBlock(FileSystem *fs, int node) {
+    int block = fs->block_map[node];
+
+    if (block <= NO_BLOCK) {
+        block = allocBlock(fs);
+        if (block == -1)
+            return -1;
+        memset(fs->image_fs + block * BLOCK_SIZE, 0, BLOCK_SIZE);
+        fs->meta->checksum[block] = zero_block_crc;
+        fs->block_map[node] = block;
+        return block;
+    }
+
+    if (fs->meta->ref_count[block] > 1) {
+        int copy = allocBlock(fs);
+        if (copy == -1)
+            return -1;
+        memcpy(fs->image_fs + copy * BLOCK_SIZE, fs->image_fs + block * BLOCK_SIZE, BLOCK_SIZE);
+        fs->meta->checksum[copy] = fs->meta->checksum[block];
+        fs->meta->ref_count[block]--;
+        fs->block_map[node] = copy;
+        return copy;
+    }
+
+    // il contenuto sta per cambiare: l'hash indicizzato non è più valido
+    unindexBlock(fs, block);
+    return block;
+}
+
+// deduplica il blocco (pieno) di un nodo: lo condivide se esiste già un blocco identico, altrimenti lo indicizza
+void dedupBlock(FileSystem *fs, int node) {
+    int block = fs->block_map[node];
+    int dup = findDuplicate(fs, fs->image_fs + block * BLOCK_SIZE, fs->meta->checksum[block]);
+    if (dup != -1 && dup != block)
+        shareBlock(fs, node, dup);
+    else
+        indexBlock(fs, block);
+}
+
 // creazione nuova subdirectory nella directory corrente
 int createDir(FileSystem *fs, const char *name) {
 
@@ -141,54 +402,41 @@ int createDir(FileSystem *fs, const char *name) {
     // cerca un posto disponibile nella directory corrente
     for (int i = 0; i < MAX_FILES; i++) {
         if (fs->current_dir[i].is_used == 0) {
-            // trova un'entry FAT libera
-            int fat_offset = -1;
-            for (int j = 0; j < FAT_ENTRIES; j++) {
-                if (fs->fat[j].next_block == FREE_BLOCK) {
-                    fat_offset = j;
-
-                    // inizializza la nuova directory
-                    strcpy(fs->current_dir[i].name, name);
-                    fs->current_dir[i].is_used = 1;
-                    fs->current_dir[i].is_directory = 1;
-                    fs->current_dir[i].start_block = fat_offset;
-                    fs->current_dir[i].size = 0;
-
-                    // trova un blocco dati libero da assegnare alla nuova directory
-                    int fat_index = findFreeDataBlockInBuffer(fs);
-                    if (fat_index == -1) {
-                        printf("No free data blocks for directory.\n");
-                        return -1;
-                    }
-
-                    int data_block = fs->fat[fat_index].next_block;
-
-                    // inizializza il blocco per la directory
-                    FileEntry *new_dir = (FileEntry *)(fs->buffer_fs + (data_block * BLOCK_SIZE));
-                    memset(new_dir, 0, BLOCK_SIZE);
-
-                    fs->fat[j].next_block = data_block;
-                    
-                    // "." entry (self)
-                    strcpy(new_dir[0].name, name);
-                    new_dir[0].is_used = 1;
-                    new_dir[0].is_directory = 1;
-                    new_dir[0].start_block = fat_offset;
-                    new_dir[0].size = 0;
-
-                    // ".." entry (parent)
-                    int parent_block = getBlockFromPtr(fs, fs->current_dir);
-
-                    strcpy(new_dir[1].name, "..");
-                    new_dir[1].is_used = 1;
-                    new_dir[1].is_directory = 1;
-                    new_dir[1].start_block = parent_block;
-                    new_dir[1].size = 0;
-                    return 0;
-                }
+            // trova un blocco dati libero da assegnare alla nuova directory: l'entry FAT restituita ne è l'header
+            int fat_offset = findFreeDataBlockInBuffer(fs);
+            if (fat_offset == -1) {
+                printf("Error: No free data block available for directory '%s'.\n", name);
+                return -1;
             }
-            printf("Error: No free data block available for directory '%s'.\n", name);
-            return -1;
+            int data_block = fs->fat[fat_offset].next_block;
+
+            // inizializza la nuova directory
+            strcpy(fs->current_dir[i].name, name);
+            fs->current_dir[i].is_used = 1;
+            fs->current_dir[i].is_directory = 1;
+            fs->current_dir[i].start_block = fat_offset;
+            fs->current_dir[i].size = 0;
+
+            // inizializza il blocco per la directory
+            FileEntry *new_dir = (FileEntry *)(fs->buffer_fs + (data_block * BLOCK_SIZE));
+            memset(new_dir, 0, BLOCK_SIZE);
+
+            // "." entry (self)
+            strcpy(new_dir[0].name, name);
+            new_dir[0].is_used = 1;
+            new_dir[0].is_directory = 1;
+            new_dir[0].start_block = fat_offset;
+            new_dir[0].size = 0;
+
+            // ".." entry (parent)
+            int parent_block = getBlockFromPtr(fs, fs->current_dir);
+
+            strcpy(new_dir[1].name, "..");
+            new_dir[1].is_used = 1;
+            new_dir[1].is_directory = 1;
+            new_dir[1].start_block = parent_block;
+            new_dir[1].size = 0;
+            return 0;
         }
     }
     printf("Error: No free slot in current directory for '%s'.\n", name);
@@ -356,6 +604,9 @@ FileHandle openFile(FileSystem *fs, const char *name) {
     fh.index = -1;
     fh.file_pos = 0;
     fh.block_pos = 0;
+    fh.pending = NULL;
+    fh.pending_len = 0;
+    fh.pending_pos = 0;
 
     if (current_open_file.index != -1) {
         printf("Error: file '%s' is currently open, please close the file before opening a new one.\n", fs->current_dir[current_open_file.index].name);
@@ -376,76 +627,160 @@ FileHandle openFile(FileSystem *fs, const char *name) {
     return fh;
 }
 
-// chiudi il file attualmente aperto
-void closeFile(FileHandle *handle) {
+// chiudi il file attualmente aperto, scrivendo prima i dati ancora nel buffer
+void closeFile(FileSystem *fs, FileHandle *handle) {
+    flushFile(fs, handle);
+    free(handle->pending);
+    handle->pending = NULL;
     handle->index = -1;
     handle->file_pos = 0;
     handle->block_pos = 0;
 }
 
-// scrivi su file
-int writeFile(FileSystem *fs, FileHandle *fh, const void *buffer, int size) {
-    if (fh->index == -1) {
-        printf("Error: Invalid file handle.\n");
+// cerca count blocchi fisici liberi consecutivi (first fit), -1 se non esiste un tratto abbastanza lungo
+int allocRun(FileSystem *fs, int count) {
+    int run = 0;
+    for (int block = POOL_START; block < POOL_END; block++) {
+        run = (fs->meta->ref_count[block] == 0) ? run + 1 : 0;
+        if (run == count) {
+            int start = block - count + 1;
+            for (int b = start; b <= block; b++) {
+                fs->meta->ref_count[b] = 1;
+                fs->meta->hash_next[b] = NOT_INDEXED;
+            }
+            return start;
+        }
+    }
+    return -1;
+}
+
+// assegna blocchi fisici ai blocchi logici [first, last] del file che ne sono privi (buchi o oltre la fine
+// della catena), in un unico tratto contiguo se possibile; restituisce il numero di blocchi allocati.
+// Se skip non è NULL, i blocchi logici con skip[index - first] vero ricevono il nodo ma non il blocco fisico
+int reserveRange(FileSystem *fs, int header, int first, int last, const char *skip) {
+    int nodes[FAT_ENTRIES];
+    int count = 0;
+
+    // controllo preliminare, senza modificare la catena: servono un blocco per ogni blocco logico ancora
+    // senza blocco fisico e al massimo altrettanti nodi, più due per il buco iniziale e la divisione finale
+    int needed = last - first + 1;
+    int skipped = 0;  // blocchi logici saltati che non hanno ancora un blocco fisico
+    for (int index = first; skip != NULL && index <= last; index++)
+        skipped += skip[index - first] != 0;
+    int pos = 0;
+    for (int node = fs->fat[header].next_block; node != FAT_EOF && pos <= last; node = fs->fat[node].next_block) {
+        if (fs->block_map[node] > NO_BLOCK && pos >= first) {
+            needed--;
+            if (skip != NULL && skip[pos - first])
+                skipped--;
+        }
+        pos += nodeSpan(fs, node);
+    }
+    int free_nodes = 0, free_blocks = 0;
+    for (int node = 0; node < FAT_ENTRIES && free_nodes < needed + 2; node++) {
+        if (fs->fat[node].next_block == FREE_BLOCK)
+            free_nodes++;
+    }
+    for (int block = POOL_START; block < POOL_END && free_blocks < needed - skipped; block++) {
+        if (fs->meta->ref_count[block] == 0)
+            free_blocks++;
+    }
+    if (free_nodes < needed + 2 || free_blocks < needed - skipped)
         return -1;
+
+    // prima passata: crea i nodi mancanti e raccoglie quelli senza blocco fisico
+    int node = seekNode(fs, header, first);
+    for (int index = first; node != -1; index++) {
+        if (fs->block_map[node] <= NO_BLOCK && (skip == NULL || !skip[index - first]))
+            nodes[count++] = node;
+        if (index == last)
+            break;
+        int next = fs->fat[node].next_block;
+        node = (next == FAT_EOF) ? nextNode(fs, node) : splitHole(fs, next, 0);
     }
+    if (node == -1 || count == 0)
+        return node == -1 ? -1 : 0;
+
+    // seconda passata: un solo tratto contiguo, altrimenti blocco per blocco
+    int start = allocRun(fs, count);
+    for (int i = 0; i < count; i++) {
+        int block = (start != -1) ? start + i : allocBlock(fs);
+        if (block == -1)
+            return -1;
+        memset(fs->image_fs + block * BLOCK_SIZE, 0, BLOCK_SIZE);
+        fs->meta->checksum[block] = zero_block_crc;
+        fs->block_map[nodes[i]] = block;
+    }
+    return count;
+}
 
+// scrittura immediata sui blocchi del file a partire da file_pos
+int writeThrough(FileSystem *fs, FileHandle *fh, const void *buffer, int size) {
     FileEntry *file = &fs->current_dir[fh->index];
     int bytes_written = 0;
     const char *data = (const char *)buffer;
 
-    int fat_index = file->start_block;
-    if (fat_index == -1 || fs->fat[fat_index].next_block == 0 || fs->fat[fat_index].next_block == FAT_EOF) {
-        printf("File has no data block yet. Allocating...\n");
-        int new_fat_index = findFreeDataBlockInBuffer(fs);
-        if (new_fat_index == -1) return -1;
-        file->start_block = new_fat_index;
-        fat_index = new_fat_index;
-    }
-    // After allocation, get the real data block
-    int block = fs->fat[fat_index].next_block;
-    if (block == FAT_EOF || block == 0) {
-        printf("Warning: start_block points to FAT_EOF or uninitialized.\n");
+    // la posizione può essere qualsiasi int dopo una seek oltre la fine: la scrittura non deve superare INT_MAX
+    if (fh->file_pos > INT_MAX - size) {
+        printf("Error: Write exceeds the maximum file size.\n");
         return -1;
     }
 
-    printf("Start at FAT %d -> data block %d\n", fat_index, block);
-
-    // Navigate to correct block for file_pos
+    // Navigate to correct node for file_pos: il primo nodo della catena è l'header creato da createFile,
+    // i blocchi saltati oltre la fine del file restano un buco non allocato
     int offset_in_file = fh->file_pos;
-    int blocks_to_skip = offset_in_file / BLOCK_SIZE;
     int offset_in_block = offset_in_file % BLOCK_SIZE;
-
-    for (int i = 0; i < blocks_to_skip; i++) {
-        if (fs->fat[block].next_block == FAT_EOF) {
-            int new_fat_index = findFreeDataBlockInBuffer(fs);
-            if (new_fat_index == -1) return bytes_written;
-            fs->fat[block].next_block = new_fat_index;
-        }
-        block = fs->fat[block].next_block;
-    }
+    int node = seekNode(fs, file->start_block, offset_in_file / BLOCK_SIZE);
+    if (node == -1) return -1;
 
     // Write data
     while (bytes_written < size) {
-        printf("Writing in block %d at file position %d\n", block, fh->file_pos);
-        void *block_ptr = fs->buffer_fs + (block * BLOCK_SIZE);
-
         int space_left = BLOCK_SIZE - offset_in_block;
         int bytes_to_write = (size - bytes_written < space_left) ? (size - bytes_written) : space_left;
-
-        memcpy((char *)block_ptr + offset_in_block, data + bytes_written, bytes_to_write);
+        const char *src = data + bytes_written;
+
+        if (bytes_to_write == BLOCK_SIZE) {
+            // blocco intero: il checksum si calcola direttamente sui dati in ingresso e, con la deduplicazione,
+            // se il contenuto esiste già basta aggiornare i metadati, senza allocare né copiare
+            uint32_t hash = hashBlock(src);
+            int dup = fs->meta->dedup ? findDuplicate(fs, src, hash) : -1;
+            if (dup != -1) {
+                shareBlock(fs, node, dup);
+            } else {
+                int block = writableBlock(fs, node);
+                if (block == -1) break;
+                memcpy(fs->image_fs + block * BLOCK_SIZE, src, BLOCK_SIZE);
+                fs->meta->checksum[block] = hash;
+                if (fs->meta->dedup)
+                    indexBlock(fs, block);
+            }
+        } else {
+            // il resto del blocco viene conservato: un blocco corrotto non va riscritto con un checksum nuovo
+            if (fs->block_map[node] > NO_BLOCK && blockCorrupted(fs, fs->block_map[node])) {
+                printf("Error: checksum mismatch in block %d (file position %d), write aborted.\n", fs->block_map[node], fh->file_pos);
+                break;
+            }
+            int block = writableBlock(fs, node);
+            if (block == -1) break;
+            printf("Writing in block %d at file position %d\n", block, fh->file_pos);
+            memcpy(fs->image_fs + block * BLOCK_SIZE + offset_in_block, src, bytes_to_write);
+            updateChecksum(fs, block);
+
+            // se con questa scrittura il blocco è diventato pieno può essere deduplicato
+            // (confronto sugli indici di blocco, la fine del blocco può superare INT_MAX)
+            int block_index = fh->file_pos / BLOCK_SIZE;
+            if (fs->meta->dedup && ((fh->file_pos + bytes_to_write) % BLOCK_SIZE == 0 || file->size / BLOCK_SIZE > block_index))
+                dedupBlock(fs, node);
+        }
 
         bytes_written += bytes_to_write;
         fh->file_pos += bytes_to_write;
         offset_in_block = 0;
 
         if (bytes_written < size) {
-            if (fs->fat[block].next_block == FAT_EOF) {
-                int new_fat_index = findFreeDataBlockInBuffer(fs);
-                if (new_fat_index == -1) return bytes_written;
-                fs->fat[block].next_block = new_fat_index;
-            }
-            block = fs->fat[block].next_block;
+            int next = fs->fat[node].next_block;
+            node = (next == FAT_EOF) ? nextNode(fs, node) : splitHole(fs, next, 0);
+            if (node == -1) break;
         }
     }
 
@@ -456,6 +791,90 @@ int writeFile(FileSystem *fs, FileHandle *fh, const void *buffer, int size) {
     return bytes_written;
 }
 
+// scrive i dati accodati nel buffer dell'handle: il tratto viene prima riservato in un'unica allocazione
+// contigua, poi scritto normalmente
+int flushFile(FileSystem *fs, FileHandle *fh) {
+    if (fh->index == -1 || fh->pending_len == 0)
+        return 0;
+
+    FileEntry *file = &fs->current_dir[fh->index];
+    int first = fh->pending_pos / BLOCK_SIZE;
+    int last = (fh->pending_pos + fh->pending_len - 1) / BLOCK_SIZE;
+
+    // con la deduplicazione i blocchi pieni già presenti (nell'indice o prima nello stesso buffer) verranno solo
+    // condivisi da writeThrough: non vanno riservati, altrimenti si allocano e azzerano blocchi subito rilasciati
+    char skip[PENDING_MAX / BLOCK_SIZE + 1] = { 0 };
+    char full[PENDING_MAX / BLOCK_SIZE + 1] = { 0 };
+    uint32_t hashes[PENDING_MAX / BLOCK_SIZE + 1];
+    for (int index = first; fs->meta->dedup && index <= last; index++) {
+        long offset = (long)index * BLOCK_SIZE - fh->pending_pos;
+        if (offset < 0 || offset + BLOCK_SIZE > fh->pending_len)
+            continue;
+        int i = index - first;
+        const char *src = fh->pending + offset;
+        full[i] = 1;
+        hashes[i] = hashBlock(src);
+        skip[i] = findDuplicate(fs, src, hashes[i]) != -1;
+        for (int j = 0; j < i && !skip[i]; j++)
+            skip[i] = full[j] && hashes[j] == hashes[i] && memcmp(fh->pending + (offset - (long)(i - j) * BLOCK_SIZE), src, BLOCK_SIZE) == 0;
+    }
+    reserveRange(fs, file->start_block, first, last, skip);  // se fallisce writeThrough alloca blocco per blocco
+
+    int file_pos = fh->file_pos;
+    int pending_len = fh->pending_len;
+    fh->file_pos = fh->pending_pos;
+    fh->pending_len = 0;
+    int bytes_written = writeThrough(fs, fh, fh->pending, pending_len);
+    fh->file_pos = file_pos;
+
+    if (bytes_written < pending_len) {
+        printf("Error: Could not flush %d buffered bytes.\n", pending_len - (bytes_written > 0 ? bytes_written : 0));
+        file->size = fh->pending_pos + (bytes_written > 0 ? bytes_written : 0);
+        return -1;
+    }
+    return 0;
+}
+
+// scrivi su file
+int writeFile(FileSystem *fs, FileHandle *fh, const void *buffer, int size) {
+    if (fh->index == -1) {
+        printf("Error: Invalid file handle.\n");
+        return -1;
+    }
+    if (fs->read_only) {
+        printf("Error: File system mounted read-only.\n");
+        return -1;
+    }
+
+    FileEntry *file = &fs->current_dir[fh->index];
+    if (fh->file_pos > INT_MAX - size) {
+        printf("Error: Write exceeds the maximum file size.\n");
+        return -1;
+    }
+
+    // allocazione ritardata: i dati accodati alla fine del file restano nel buffer dell'handle
+    // e ricevono i blocchi tutti insieme al flush (close, read, seek o altri comandi)
+    if (fh->file_pos == file->size && size <= PENDING_MAX) {
+        if (fh->pending_len + size > PENDING_MAX && flushFile(fs, fh) == -1)
+            return -1;
+        if (fh->pending == NULL && (fh->pending = malloc(PENDING_MAX)) == NULL)
+            return writeThrough(fs, fh, buffer, size);
+        if (fh->pending_len == 0)
+            fh->pending_pos = fh->file_pos;
+
+        memcpy(fh->pending + fh->pending_len, buffer, size);
+        fh->pending_len += size;
+        fh->file_pos += size;
+        file->size = fh->file_pos;
+        printf("Buffered %d bytes (%d pending).\n", size, fh->pending_len);
+        return size;
+    }
+
+    if (flushFile(fs, fh) == -1)
+        return -1;
+    return writeThrough(fs, fh, buffer, size);
+}
+
 // leggi il file attualmente aperto
 int readFile(FileSystem *fs, FileHandle *fh, void *buffer, int size) {
     if (fh->index == -1) {
@@ -463,14 +882,17 @@ int readFile(FileSystem *fs, FileHandle *fh, void *buffer, int size) {
         return -1;
     }
 
+    if (flushFile(fs, fh) == -1)
+        return -1;
+
     FileEntry *file = &fs->current_dir[fh->index];
     int bytes_read = 0;
     char *data = (char *)buffer;
     int fat_index = file->start_block;
-        if (fat_index == -1 || fs->fat[fat_index].next_block == FAT_EOF) {
+        if (fat_index == -1) {
             return 0; // file has no data
         }
-    int block = fs->fat[fat_index].next_block;
+    int node = fs->fat[fat_index].next_block;
 
 
     int offset_in_file = fh->file_pos;
@@ -484,33 +906,42 @@ int readFile(FileSystem *fs, FileHandle *fh, void *buffer, int size) {
         size = max_readable;
     }
 
-    // Skip blocks to reach the right position
-    int blocks_to_skip = offset_in_file / BLOCK_SIZE;
+    // Skip nodes to reach the right position (un nodo buco può coprire più blocchi)
+    int index = offset_in_file / BLOCK_SIZE;
     int offset_in_block = offset_in_file % BLOCK_SIZE;
+    int pos = 0;
 
-    for (int i = 0; i < blocks_to_skip; i++) {
-        if (block == FAT_EOF) {
-            return 0; // reached EOF before position
-        }
-        block = fs->fat[block].next_block;
+    while (node != FAT_EOF && pos + nodeSpan(fs, node) <= index) {
+        pos += nodeSpan(fs, node);
+        node = fs->fat[node].next_block;
     }
 
-    // Begin reading
-    while (bytes_read < size && block != FAT_EOF) {
-        void *block_ptr = fs->buffer_fs + (block * BLOCK_SIZE);
-
+    // Begin reading (oltre la fine della catena, ad esempio dopo un truncate che estende il file, si legge zero)
+    while (bytes_read < size) {
         int space_left = BLOCK_SIZE - offset_in_block;
         int bytes_to_read = (size - bytes_read < space_left) ? (size - bytes_read) : space_left;
 
-        memcpy(data + bytes_read, (char *)block_ptr + offset_in_block, bytes_to_read);
+        if (node != FAT_EOF && fs->block_map[node] > NO_BLOCK) {
+            int block = fs->block_map[node];
+            void *block_ptr = fs->image_fs + (block * BLOCK_SIZE);
+            if (blockCorrupted(fs, block)) {
+                printf("Error: checksum mismatch in block %d (file position %d).\n", block, fh->file_pos);
+                return -1;
+            }
+            memcpy(data + bytes_read, (char *)block_ptr + offset_in_block, bytes_to_read);
+        } else {
+            memset(data + bytes_read, 0, bytes_to_read);  // buco: si legge zero senza toccare lo storage
+        }
 
         bytes_read += bytes_to_read;
         fh->file_pos += bytes_to_read;
 
         offset_in_block = 0; // reset for next block
+        index++;
 
-        if (bytes_read < size) {
-            block = fs->fat[block].next_block;
+        if (node != FAT_EOF && pos + nodeSpan(fs, node) <= index) {
+            pos += nodeSpan(fs, node);
+            node = fs->fat[node].next_block;
         }
     }
 
@@ -530,30 +961,732 @@ int seekFile(FileSystem *fs, FileHandle *fh, int position) {
         return -1;
     }
 
+    if (flushFile(fs, fh) == -1)
+        return -1;
+
+    // la posizione può superare la fine del file: una successiva scrittura lascerà un buco,
+    // quindi non serve percorrere la catena
     fh->file_pos = position;
+    fh->block_pos = position % BLOCK_SIZE;
 
-    // bisogna calcolare il nuovo valore di block_pos
-    int block = fs->current_dir[fh->index].start_block;
-    int offset_in_file = fh->file_pos;
-    int blocks_to_skip = offset_in_file / BLOCK_SIZE;
-    int offset_in_block = offset_in_file % BLOCK_SIZE;
+    return 0;
+}
 
-    for (int i = 0; i < blocks_to_skip; i++) {
-        if (block == FAT_EOF) {
-            return -1;
+// cerca un file (non directory) nella directory corrente
+int findFile(FileSystem *fs, const char *name) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (fs->current_dir[i].is_used && !fs->current_dir[i].is_directory && strcmp(fs->current_dir[i].name, name) == 0)
+            return i;
+    }
+    printf("Error: File '%s' not found.\n", name);
+    return -1;
+}
+
+// preallocazione: riserva blocchi contigui per [offset, offset + length) senza cambiare la dimensione del file,
+// le scritture successive in quel tratto non dovranno allocare nulla
+int fallocateFile(FileSystem *fs, const char *name, int offset, int length) {
+    if (offset < 0 || length <= 0 || length > INT_MAX - offset) {
+        printf("Error: Invalid range.\n");
+        return -1;
+    }
+    int index = findFile(fs, name);
+    if (index == -1)
+        return -1;
+    if (current_open_file.index == index && flushFile(fs, &current_open_file) == -1)
+        return -1;
+
+    int count = reserveRange(fs, fs->current_dir[index].start_block, offset / BLOCK_SIZE, (offset + length - 1) / BLOCK_SIZE, NULL);
+    if (count == -1) {
+        printf("Error: Not enough space to reserve %d bytes for '%s'.\n", length, name);
+        return -1;
+    }
+    printf("Reserved %d blocks for '%s'.\n", count, name);
+    return 0;
+}
+
+// cambia la dimensione di un file: riducendola rilascia i blocchi oltre la nuova fine (anche quelli preallocati),
+// aumentandola non alloca nulla e il tratto aggiunto si legge come zeri
+int truncateFile(FileSystem *fs, const char *name, int size) {
+    if (size < 0) {
+        printf("Error: Invalid size (negative size).\n");
+        return -1;
+    }
+    int index = findFile(fs, name);
+    if (index == -1)
+        return -1;
+    if (current_open_file.index == index && flushFile(fs, &current_open_file) == -1)
+        return -1;
+
+    FileEntry *file = &fs->current_dir[index];
+    int keep = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;  // blocchi logici che restano
+
+    // trova l'ultimo nodo da tenere, accorciando un eventuale buco a cavallo della nuova fine
+    int prev = file->start_block;
+    int node = fs->fat[prev].next_block;
+    int pos = 0;
+    while (node != FAT_EOF && pos + nodeSpan(fs, node) <= keep) {
+        pos += nodeSpan(fs, node);
+        prev = node;
+        node = fs->fat[node].next_block;
+    }
+
+    // la coda dell'ultimo blocco va azzerata, così un'estensione successiva legge zeri: solo se la catena arriva
+    // fino al blocco keep - 1 (dopo un truncate che ha esteso il file può essere più corta). Il blocco viene
+    // modificato solo in parte, quindi va controllato prima di toccare la catena
+    int zero_tail = size < file->size && size % BLOCK_SIZE != 0 && pos == keep && prev != file->start_block && fs->block_map[prev] > NO_BLOCK;
+    if (zero_tail && blockCorrupted(fs, fs->block_map[prev])) {
+        printf("Error: checksum mismatch in block %d, truncate aborted.\n", fs->block_map[prev]);
+        return -1;
+    }
+
+    if (node != FAT_EOF && pos < keep) {
+        fs->block_map[node] = -(keep - pos);
+        prev = node;
+        node = fs->fat[node].next_block;
+    }
+    fs->fat[prev].next_block = FAT_EOF;
+    freeChain(fs, node);
+
+    if (zero_tail) {
+        int block = writableBlock(fs, prev);
+        if (block != -1) {
+            memset(fs->image_fs + block * BLOCK_SIZE + size % BLOCK_SIZE, 0, BLOCK_SIZE - size % BLOCK_SIZE);
+            updateChecksum(fs, block);
+        }
+    }
+
+    file->size = size;
+    printf("File '%s' truncated to %d bytes.\n", name, size);
+    return 0;
+}
+
+// checksum dei metadati dei blocchi: copre tutta la struttura dopo il campo che lo contiene
+uint32_t metaChecksum(FileSystem *fs) {
+    return crc32c(&fs->meta->dedup, sizeof(BlockMeta) - offsetof(BlockMeta, dedup));
+}
+
+// annota quali blocchi della zona indirizzata dalla FAT sono integri prima di eseguire un comando
+void checkMetadata(FileSystem *fs) {
+    for (int block = 0; block < POOL_START; block++)
+        fs->zone_ok[block] = crc32c(fs->image_fs + block * BLOCK_SIZE, BLOCK_SIZE) == fs->meta->checksum[block];
+    fs->meta_ok = metaChecksum(fs) == fs->meta->meta_checksum;
+}
+
+// aggiorna i checksum della zona indirizzata dalla FAT (tabella, root e directory): viene modificata in molti
+// punti, quindi i checksum si ricalcolano tutti insieme dopo ogni comando (sono al massimo FAT_ENTRIES blocchi).
+// Un blocco già corrotto prima del comando conserva il vecchio checksum, così scrub continua a segnalarlo
+void syncChecksums(FileSystem *fs) {
+    for (int block = 0; block < POOL_START; block++) {
+        if (fs->zone_ok[block])
+            updateChecksum(fs, block);
+    }
+    if (fs->meta_ok)
+        fs->meta->meta_checksum = metaChecksum(fs);
+}
+
+// verifica i checksum dei metadati e di tutti i blocchi dati in uso, restituisce il numero di blocchi corrotti
+int verifyFS(FileSystem *fs) {
+    int bad = 0;
+    for (int block = 0; block < POOL_END; block++) {
+        if (block >= POOL_START && fs->meta->ref_count[block] == 0)
+            continue;
+        if (crc32c(fs->image_fs + block * BLOCK_SIZE, BLOCK_SIZE) != fs->meta->checksum[block]) {
+            printf("Checksum mismatch in %s block %d.\n", block < POOL_START ? "metadata" : "data", block);
+            bad++;
+        }
+    }
+    if (metaChecksum(fs) != fs->meta->meta_checksum) {
+        printf("Checksum mismatch in block metadata.\n");
+        bad++;
+    }
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (fs->meta->snapshots[i].is_used && snapshotChecksum(fs, i) != fs->meta->snapshots[i].checksum) {
+            printf("Checksum mismatch in snapshot '%s'.\n", fs->meta->snapshots[i].name);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+// formatta il file system: inizializza FAT, root directory e metadati dei blocchi
+void formatFS(FileSystem *fs) {
+    int root_block = (FAT_ENTRIES * sizeof(FATEntry)) / BLOCK_SIZE;
+
+    // inizializza FAT e root directory
+    memset(fs->fat, 0, FAT_ENTRIES * sizeof(FATEntry));
+    memset(fs->root, 0, MAX_FILES * sizeof(FileEntry));
+
+    fs->root[0].is_used = 1;
+    fs->root[0].is_directory = 1;
+    strcpy(fs->root[0].name, "/");
+    fs->root[0].start_block = 1;
+    fs->fat[0].next_block = FAT_EOF;
+    fs->fat[1].next_block = root_block;
+    fs->fat[root_block].next_block = FAT_EOF;
+    for (int i=3; i < FAT_ENTRIES; i++)
+        fs->fat[i].next_block = FREE_BLOCK;
+
+    // inizializza i metadati dei blocchi (mappa vuota, nessun blocco indicizzato)
+    memset(fs->meta, 0, sizeof(BlockMeta));
+    for (int b = 0; b < BLOCK_ENTRIES; b++)
+        fs->meta->hash_next[b] = NOT_INDEXED;
+    for (int h = 0; h < HASH_BUCKETS; h++)
+        fs->meta->hash_head[h] = -1;
+    fs->meta->magic = FS_MAGIC;
+    fs->meta->version = FS_VERSION;
+    fs->meta->verify = 1;
+    memset(fs->zone_ok, 1, sizeof(fs->zone_ok));
+    fs->meta_ok = 1;
+    syncChecksums(fs);
+}
+
+// copia un file nella directory corrente: con reflink i blocchi dati vengono solo condivisi (copy-on-write),
+// altrimenti ogni blocco viene duplicato
+int cloneFile(FileSystem *fs, const char *src, const char *dst, int reflink) {
+    int src_index = -1;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (fs->current_dir[i].is_used && !fs->current_dir[i].is_directory && strcmp(fs->current_dir[i].name, src) == 0) {
+            src_index = i;
+            break;
+        }
+    }
+    if (src_index == -1) {
+        printf("Error: File '%s' not found.\n", src);
+        return -1;
+    }
+
+    if (createFile(fs, dst, 0) == -1)
+        return -1;
+    int dst_index = -1;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (fs->current_dir[i].is_used && strcmp(fs->current_dir[i].name, dst) == 0) {
+            dst_index = i;
+            break;
+        }
+    }
+    FileEntry *src_file = &fs->current_dir[src_index];
+    FileEntry *dst_file = &fs->current_dir[dst_index];
+
+    // ricostruisce la catena della copia puntando agli stessi blocchi fisici
+    int src_node = fs->fat[src_file->start_block].next_block;
+    int dst_node = dst_file->start_block;
+    while (src_node != FAT_EOF) {
+        dst_node = nextNode(fs, dst_node);
+        if (dst_node == -1)
+            break;
+        if (fs->block_map[src_node] > NO_BLOCK) {
+            shareBlock(fs, dst_node, fs->block_map[src_node]);
+            if (!reflink && writableBlock(fs, dst_node) == -1) {
+                dst_node = -1;
+                break;
+            }
+        } else {
+            fs->block_map[dst_node] = fs->block_map[src_node];  // i buchi restano buchi anche nella copia
+        }
+        src_node = fs->fat[src_node].next_block;
+    }
+    if (dst_node == -1) {
+        printf("Error: Not enough space to copy '%s'.\n", src);
+        freeChain(fs, dst_file->start_block);
+        memset(dst_file, 0, sizeof(FileEntry));
+        return -1;
+    }
+
+    dst_file->size = src_file->size;
+    printf("Copied '%s' to '%s'%s.\n", src, dst, reflink ? " (reflink)" : "");
+    return 0;
+}
+
+// imposta la vista del file system: zona indirizzata dalla FAT e mappa dei nodi
+void selectView(FileSystem *fs, void *zone, int *block_map) {
+    fs->buffer_fs = zone;
+    fs->fat = (FATEntry *)zone;
+    fs->root = (FileEntry *)(zone + (FAT_ENTRIES * sizeof(FATEntry)));
+    fs->current_dir = fs->root;
+    fs->block_map = block_map;
+}
+
+Snapshot *getSnapshot(FileSystem *fs, int slot) {
+    return (Snapshot *)(fs->image_fs + (SNAPSHOT_START + slot * SNAPSHOT_BLOCKS) * BLOCK_SIZE);
+}
+
+// checksum della copia salvata nello slot: lo snapshot non cambia più dopo la creazione
+uint32_t snapshotChecksum(FileSystem *fs, int slot) {
+    return crc32c(getSnapshot(fs, slot), sizeof(Snapshot));
+}
+
+int findSnapshot(FileSystem *fs, const char *name) {
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (fs->meta->snapshots[i].is_used && strcmp(fs->meta->snapshots[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// crea uno snapshot del file system attivo: copia solo i metadati (dimensione fissa, indipendente dai dati)
+// e aggiunge un riferimento ad ogni blocco dati, che da quel momento verrà copiato alla prima modifica
+int createSnapshot(FileSystem *fs, const char *name) {
+    if (strlen(name) >= 16) {
+        printf("Error: name is too long.\n");
+        return -1;
+    }
+    if (findSnapshot(fs, name) != -1) {
+        printf("Error: A snapshot with the name '%s' already exists.\n", name);
+        return -1;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+        if (!fs->meta->snapshots[i].is_used) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) {
+        printf("Error: No free snapshot slot (max %d).\n", MAX_SNAPSHOTS);
+        return -1;
+    }
+    // lo snapshot riceve un checksum nuovo: non deve copiare metadati già corrotti
+    int corrupted = !fs->meta_ok;
+    for (int block = 0; block < POOL_START; block++)
+        corrupted |= !fs->zone_ok[block];
+    if (corrupted) {
+        printf("Error: Corrupted metadata, use 'scrub' to list the damaged blocks.\n");
+        return -1;
+    }
+
+    Snapshot *snap = getSnapshot(fs, slot);
+    memcpy(snap->zone, fs->image_fs, sizeof(snap->zone));
+    memcpy(snap->block_map, fs->meta->block_map, sizeof(snap->block_map));
+    for (int node = 0; node < FAT_ENTRIES; node++) {
+        if (snap->block_map[node] > NO_BLOCK)
+            fs->meta->ref_count[snap->block_map[node]]++;
+    }
+
+    strcpy(fs->meta->snapshots[slot].name, name);
+    fs->meta->snapshots[slot].is_used = 1;
+    fs->meta->snapshots[slot].checksum = snapshotChecksum(fs, slot);
+    printf("Snapshot '%s' created.\n", name);
+    return 0;
+}
+
+// elimina uno snapshot rilasciando i blocchi dati che referenziava
+int eraseSnapshot(FileSystem *fs, const char *name) {
+    int slot = findSnapshot(fs, name);
+    if (slot == -1) {
+        printf("Error: Snapshot '%s' not found.\n", name);
+        return -1;
+    }
+
+    Snapshot *snap = getSnapshot(fs, slot);
+    for (int node = 0; node < FAT_ENTRIES; node++) {
+        if (snap->block_map[node] > NO_BLOCK)
+            releaseBlock(fs, snap->block_map[node]);
+    }
+
+    memset(&fs->meta->snapshots[slot], 0, sizeof(SnapshotInfo));
+    printf("Snapshot '%s' deleted successfully.\n", name);
+    return 0;
+}
+
+// monta uno snapshot in sola lettura al posto del file system attivo
+int mountSnapshot(FileSystem *fs, const char *name) {
+    if (current_open_file.index != -1) {
+        printf("Error: open file '%s' detected. Please close it before mounting a snapshot.\n", fs->current_dir[current_open_file.index].name);
+        return -1;
+    }
+    if (fs->read_only) {
+        printf("Error: A snapshot is already mounted, use 'umount' first.\n");
+        return -1;
+    }
+    int slot = findSnapshot(fs, name);
+    if (slot == -1) {
+        printf("Error: Snapshot '%s' not found.\n", name);
+        return -1;
+    }
+
+    if (fs->meta->verify && snapshotChecksum(fs, slot) != fs->meta->snapshots[slot].checksum) {
+        printf("Error: checksum mismatch in snapshot '%s'.\n", name);
+        return -1;
+    }
+
+    Snapshot *snap = getSnapshot(fs, slot);
+    selectView(fs, snap->zone, snap->block_map);
+    fs->read_only = 1;
+    printf("Mounted snapshot '%s' (read-only).\n", name);
+    return 0;
+}
+
+// torna al file system attivo
+void unmountSnapshot(FileSystem *fs) {
+    if (current_open_file.index != -1)
+        closeFile(fs, &current_open_file);
+    selectView(fs, fs->image_fs, fs->meta->block_map);
+    fs->read_only = 0;
+    printf("Snapshot unmounted.\n");
+}
+
+// aggiunge una directory alla deque del worker
+void pushWork(Walker *w, int worker, int item) {
+    WorkDeque *dq = &w->deques[worker];
+    pthread_mutex_lock(&dq->lock);
+    dq->items[dq->bottom++] = item;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+// il worker prende l'ultima directory inserita nella propria deque
+int popWork(Walker *w, int worker) {
+    WorkDeque *dq = &w->deques[worker];
+    int item = -1;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top)
+        item = dq->items[--dq->bottom];
+    pthread_mutex_unlock(&dq->lock);
+    return item;
+}
+
+// senza lavoro proprio, il worker ruba la directory più vecchia dalla deque di un altro worker
+int stealWork(Walker *w, int worker) {
+    for (int i = 1; i < w->workers; i++) {
+        WorkDeque *dq = &w->deques[(worker + i) % w->workers];
+        int item = -1;
+        pthread_mutex_lock(&dq->lock);
+        if (dq->bottom > dq->top)
+            item = dq->items[dq->top++];
+        pthread_mutex_unlock(&dq->lock);
+        if (item != -1)
+            return item;
+    }
+    return -1;
+}
+
+// visita count entry contigue di una directory e mette in coda le sottodirectory
+void scanEntries(Walker *w, int worker, WalkItem *dir, FileEntry *entries, int first, int count) {
+    FileSystem *fs = w->fs;
+    for (int i = first; i < count; i++) {
+        if (!entries[i].is_used)
+            continue;
+
+        char path[WALK_PATH_MAX];
+        snprintf(path, sizeof(path), "%.*s/%s", WALK_PATH_MAX - 17, dir->path, entries[i].name);  // il nome è al massimo 15 caratteri
+        w->visit(w, worker, &entries[i], path);
+
+        if (entries[i].is_directory) {
+            int item = atomic_fetch_add(&w->item_count, 1);
+            if (item >= FAT_ENTRIES) {
+                printf("Error: too many directories, '%s' skipped.\n", path);
+                continue;
+            }
+            w->items[item].block = fs->fat[entries[i].start_block].next_block;
+            strcpy(w->items[item].path, path);
+            atomic_fetch_add(&w->pending, 1);
+            pushWork(w, worker, item);
+        }
+    }
+}
+
+// vero se il blocco contiene una directory: la sua prima entry è la directory stessa, il cui header punta al blocco
+int isDirBlock(FileSystem *fs, int block) {
+    FileEntry *self = (FileEntry *)(fs->buffer_fs + block * BLOCK_SIZE);
+    return self->is_used && self->is_directory && self->start_block >= 0 && self->start_block < FAT_ENTRIES &&
+           fs->fat[self->start_block].next_block == block;
+}
+
+// blocchi occupati dalle entry di una sottodirectory: createFile e createDir usano fino a MAX_FILES entry a partire
+// dal blocco della directory, quindi le entry proseguono nei blocchi successivi fino al blocco di un'altra directory
+int dirBlocks(FileSystem *fs, int data_block) {
+    int count = 1;
+    while (count < MAX_FILES / (int)ENTRIES_PER_BLOCK && data_block + count < FAT_ENTRIES && !isDirBlock(fs, data_block + count))
+        count++;
+    return count;
+}
+
+// esamina le entry di una directory: visita ognuna e mette in coda le sottodirectory
+void scanDir(Walker *w, int worker, WalkItem *dir) {
+    FileSystem *fs = w->fs;
+    // la root occupa MAX_FILES entry contigue fuori dalla FAT, la prima è la root stessa
+    if (dir->block == getBlockFromPtr(fs, fs->root)) {
+        scanEntries(w, worker, dir, fs->root, 1, MAX_FILES);
+        return;
+    }
+
+    // le prime due entry sono la directory stessa e la parent
+    FileEntry *dir_entries = (FileEntry *)(fs->buffer_fs + dir->block * BLOCK_SIZE);
+    scanEntries(w, worker, dir, dir_entries, 2, dirBlocks(fs, dir->block) * ENTRIES_PER_BLOCK);
+}
+
+typedef struct {
+    Walker *walker;
+    int id;
+} WorkerArg;
+
+void *walkWorker(void *arg) {
+    Walker *w = ((WorkerArg *)arg)->walker;
+    int id = ((WorkerArg *)arg)->id;
+
+    // termina quando non ci sono più directory né in coda né in elaborazione presso altri worker
+    while (atomic_load(&w->pending) > 0) {
+        int item = popWork(w, id);
+        if (item == -1)
+            item = stealWork(w, id);
+        if (item == -1) {
+            sched_yield();
+            continue;
         }
-        block = fs->fat[block].next_block;
+        scanDir(w, id, &w->items[item]);
+        atomic_fetch_sub(&w->pending, 1);
+    }
+    return NULL;
+}
+
+// visita in parallelo il sottoalbero della directory con blocco dati dir_block, chiamando visit per ogni entry
+void walkTree(FileSystem *fs, int dir_block, const char *path, VisitFn visit, void *ctx) {
+    Walker *w = malloc(sizeof(Walker));
+    if (w == NULL || (w->items = malloc(FAT_ENTRIES * sizeof(WalkItem))) == NULL) {
+        printf("Error: Not enough memory to walk the directory tree.\n");
+        free(w);
+        return;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    w->workers = (cpus < 1) ? 1 : (cpus > MAX_WORKERS ? MAX_WORKERS : (int)cpus);
+    w->fs = fs;
+    w->visit = visit;
+    w->ctx = ctx;
+    for (int i = 0; i < w->workers; i++) {
+        w->deques[i].top = 0;
+        w->deques[i].bottom = 0;
+        pthread_mutex_init(&w->deques[i].lock, NULL);
+    }
+
+    // la directory di partenza va nella deque del worker 0, gli altri inizieranno rubando
+    w->items[0].block = dir_block;
+    snprintf(w->items[0].path, WALK_PATH_MAX, "%s", path);
+    atomic_init(&w->item_count, 1);
+    atomic_init(&w->pending, 1);
+    pushWork(w, 0, 0);
+
+    pthread_t threads[MAX_WORKERS];
+    WorkerArg args[MAX_WORKERS];
+    int started = 1;
+    for (int i = 1; i < w->workers; i++) {
+        args[i].walker = w;
+        args[i].id = i;
+        if (pthread_create(&threads[i], NULL, walkWorker, &args[i]) != 0)
+            break;
+        started++;
+    }
+    args[0].walker = w;
+    args[0].id = 0;
+    walkWorker(&args[0]);  // il thread chiamante lavora come worker 0
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < w->workers; i++)
+        pthread_mutex_destroy(&w->deques[i].lock);
+    free(w->items);
+    free(w);
+}
+
+// cerca un'entry (file o directory) nella directory corrente
+int findEntry(FileSystem *fs, const char *name) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (fs->current_dir[i].is_used && strcmp(fs->current_dir[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// rm -r: i worker raccolgono le catene da liberare, che vengono poi rilasciate tutte insieme
+typedef struct {
+    int chains[FAT_ENTRIES];  // primo nodo (header) di ogni file e directory del sottoalbero
+    atomic_int count;
+    int dir_blocks[FAT_ENTRIES];  // blocchi dati delle directory, da azzerare
+    atomic_int dir_count;
+} EraseCtx;
+
+void visitErase(Walker *w, int worker, FileEntry *entry, const char *path) {
+    (void)worker;
+    (void)path;
+    EraseCtx *ctx = (EraseCtx *)w->ctx;
+    int i = atomic_fetch_add(&ctx->count, 1);
+    if (i < FAT_ENTRIES)
+        ctx->chains[i] = entry->start_block;
+    if (entry->is_directory) {
+        i = atomic_fetch_add(&ctx->dir_count, 1);
+        if (i < FAT_ENTRIES)
+            ctx->dir_blocks[i] = w->fs->fat[entry->start_block].next_block;
     }
+}
 
-    fh->block_pos = offset_in_block;
+// elimina ricorsivamente una directory con tutto il suo contenuto
+int eraseTree(FileSystem *fs, const char *name) {
+    int index = findEntry(fs, name);
+    if (index == -1) {
+        printf("Error: '%s' not found.\n", name);
+        return -1;
+    }
+    if (!fs->current_dir[index].is_directory)
+        return eraseFile(fs, name);
+    if (index == 0 || (fs->current_dir != fs->root && index == 1)) {
+        printf("Impossibile eliminare root e/o directory di riferimento.\n");
+        return -1;
+    }
 
+    EraseCtx *ctx = malloc(sizeof(EraseCtx));
+    if (ctx == NULL) {
+        printf("Error: Not enough memory.\n");
+        return -1;
+    }
+    atomic_init(&ctx->count, 0);
+    atomic_init(&ctx->dir_count, 0);
+
+    FileEntry *dir = &fs->current_dir[index];
+    int dir_block = fs->fat[dir->start_block].next_block;
+    walkTree(fs, dir_block, name, visitErase, ctx);
+
+    // rilascio in blocco: prima le directory vengono svuotate (le entry non devono ricomparire
+    // quando il blocco verrà riusato), poi si liberano i nodi FAT e i riferimenti ai blocchi dati.
+    // L'estensione di ogni directory si calcola prima di azzerarne qualcuna, perché dipende dai blocchi vicini
+    int dir_count = atomic_load(&ctx->dir_count);
+    if (dir_count > FAT_ENTRIES - 1)
+        dir_count = FAT_ENTRIES - 1;
+    ctx->dir_blocks[dir_count++] = dir_block;
+    int spans[FAT_ENTRIES];
+    for (int i = 0; i < dir_count; i++)
+        spans[i] = dirBlocks(fs, ctx->dir_blocks[i]);
+    for (int i = 0; i < dir_count; i++)
+        memset(fs->buffer_fs + ctx->dir_blocks[i] * BLOCK_SIZE, 0, spans[i] * BLOCK_SIZE);
+
+    int count = atomic_load(&ctx->count);
+    if (count > FAT_ENTRIES)
+        count = FAT_ENTRIES;
+    for (int i = 0; i < count; i++)
+        freeChain(fs, ctx->chains[i]);
+    freeChain(fs, dir->start_block);
+    memset(dir, 0, sizeof(FileEntry));
+    free(ctx);
+
+    printf("Directory '%s' and %d entries deleted successfully.\n", name, count);
     return 0;
 }
 
+// du: ogni worker accumula i propri totali, sommati alla fine
+typedef struct {
+    long bytes;
+    int blocks;  // blocchi fisici referenziati (i buchi non contano)
+    int files;
+    int dirs;
+} DuStats;
+
+int countBlocks(FileSystem *fs, int header) {
+    int blocks = 0;
+    for (int node = fs->fat[header].next_block; node != FAT_EOF; node = fs->fat[node].next_block) {
+        if (fs->block_map[node] > NO_BLOCK)
+            blocks++;
+    }
+    return blocks;
+}
+
+void visitUsage(Walker *w, int worker, FileEntry *entry, const char *path) {
+    (void)path;
+    DuStats *stats = &((DuStats *)w->ctx)[worker];
+    if (entry->is_directory) {
+        stats->dirs++;
+        stats->blocks++;
+    } else {
+        stats->files++;
+        stats->bytes += entry->size;
+        stats->blocks += countBlocks(w->fs, entry->start_block);
+    }
+}
+
+// mostra lo spazio occupato da un file o da un sottoalbero (di default la directory corrente)
+void diskUsage(FileSystem *fs, const char *name) {
+    DuStats stats[MAX_WORKERS];
+    memset(stats, 0, sizeof(stats));
+
+    if (name == NULL) {
+        walkTree(fs, getBlockFromPtr(fs, fs->current_dir), ".", visitUsage, stats);
+        name = ".";
+    } else {
+        int index = findEntry(fs, name);
+        if (index == -1) {
+            printf("Error: '%s' not found.\n", name);
+            return;
+        }
+        FileEntry *entry = &fs->current_dir[index];
+        if (entry->is_directory)
+            walkTree(fs, fs->fat[entry->start_block].next_block, name, visitUsage, stats);
+        else {
+            stats[0].files = 1;
+            stats[0].bytes = entry->size;
+            stats[0].blocks = countBlocks(fs, entry->start_block);
+        }
+    }
+
+    for (int i = 1; i < MAX_WORKERS; i++) {
+        stats[0].bytes += stats[i].bytes;
+        stats[0].blocks += stats[i].blocks;
+        stats[0].files += stats[i].files;
+        stats[0].dirs += stats[i].dirs;
+    }
+    printf("%ld bytes in %d files, %d directories, %d blocks allocated (%d bytes): %s\n",
+           stats[0].bytes, stats[0].files, stats[0].dirs, stats[0].blocks, stats[0].blocks * BLOCK_SIZE, name);
+}
+
+// find: i percorsi che corrispondono al pattern vengono raccolti e stampati in ordine alla fine
+typedef struct {
+    const char *pattern;
+    char (*matches)[WALK_PATH_MAX];
+    atomic_int count;
+} FindCtx;
+
+void visitFind(Walker *w, int worker, FileEntry *entry, const char *path) {
+    (void)worker;
+    FindCtx *ctx = (FindCtx *)w->ctx;
+    if (fnmatch(ctx->pattern, entry->name, 0) != 0)
+        return;
+    int i = atomic_fetch_add(&ctx->count, 1);
+    if (i < FAT_ENTRIES)
+        snprintf(ctx->matches[i], WALK_PATH_MAX, "%s%s", path, entry->is_directory ? "/" : "");
+}
+
+int comparePaths(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+// cerca nel sottoalbero della directory corrente le entry il cui nome corrisponde al pattern (glob)
+void findEntries(FileSystem *fs, const char *pattern) {
+    FindCtx ctx;
+    ctx.pattern = pattern;
+    ctx.matches = malloc(FAT_ENTRIES * WALK_PATH_MAX);
+    if (ctx.matches == NULL) {
+        printf("Error: Not enough memory.\n");
+        return;
+    }
+    atomic_init(&ctx.count, 0);
+
+    walkTree(fs, getBlockFromPtr(fs, fs->current_dir), ".", visitFind, &ctx);
+
+    int count = atomic_load(&ctx.count);
+    if (count > FAT_ENTRIES)
+        count = FAT_ENTRIES;
+    qsort(ctx.matches, count, WALK_PATH_MAX, comparePaths);
+    for (int i = 0; i < count; i++)
+        printf("%s\n", ctx.matches[i]);
+    if (count == 0)
+        printf("No entries matching '%s'.\n", pattern);
+    free(ctx.matches);
+}
+
 // chiusura e uscita dal file system
 void cleanup(FileSystem *fs) {
     printf("Exiting file system...\n");
-    if (munmap(fs->buffer_fs, FS_SIZE) == -1)
+    if (current_open_file.index != -1)
+        closeFile(fs, &current_open_file);
+    syncChecksums(fs);
+    if (munmap(fs->image_fs, FS_SIZE) == -1)
         perror("Error unmapping memory.");
     if (close(fs->fs_fd) == -1)
         perror("Error closing file descriptor of the file system.");
@@ -563,8 +1696,24 @@ void cleanup(FileSystem *fs) {
 
 // elabora comando ricevuto in input
 void processCommand(FileSystem *fs, const char *input) {
-    char command[32], arg1[32], arg2[32];
-    int n = sscanf(input, "%s %s %s", command, arg1, arg2);
+    char command[32], arg1[32], arg2[32], arg3[32];
+    int n = sscanf(input, "%s %s %s %s", command, arg1, arg2, arg3);
+
+    // con uno snapshot montato sono ammessi solo i comandi che non modificano il file system
+    const char *write_commands[] = { "mk", "rm", "mkdir", "rmdir", "write", "cp", "fallocate", "truncate", "snapshot", "rmsnapshot" };
+    for (int i = 0; fs->read_only && n > 0 && i < (int)(sizeof(write_commands) / sizeof(write_commands[0])); i++) {
+        if (strcmp(command, write_commands[i]) == 0) {
+            printf("Error: snapshot mounted read-only, use 'umount' first.\n");
+            return;
+        }
+    }
+
+    checkMetadata(fs);
+
+    // i dati accodati con write restano nel buffer solo fino al primo comando diverso
+    if (n > 0 && strcmp(command, "write") != 0)
+        flushFile(fs, &current_open_file);
+
     if (strcmp(command, "exit") == 0) {
         cleanup(fs);
     }
@@ -577,8 +1726,10 @@ void processCommand(FileSystem *fs, const char *input) {
     else if (strcmp(command, "rm") == 0) {
         if (n == 2)
             eraseFile(fs, arg1);
+        else if (n == 3 && strcmp(arg1, "-r") == 0)
+            eraseTree(fs, arg2);
         else
-            printf("To use this command: rm <filename>\n");
+            printf("To use this command: rm [-r] <filename>\n");
     }
     else if (strcmp(command, "mkdir") == 0) {
         if (n == 2)
@@ -592,6 +1743,115 @@ void processCommand(FileSystem *fs, const char *input) {
         else
             printf("To use this command: rmdir <directoryname>\n");
     }
+    else if (strcmp(command, "cp") == 0) {
+        if (n == 3)
+            cloneFile(fs, arg1, arg2, 0);
+        else if (n == 4 && strcmp(arg1, "--reflink") == 0)
+            cloneFile(fs, arg2, arg3, 1);
+        else
+            printf("To use this command: cp [--reflink] <source> <destination>\n");
+    }
+    else if (strcmp(command, "fallocate") == 0) {
+        if (n == 3)
+            fallocateFile(fs, arg1, 0, atoi(arg2));
+        else if (n == 4)
+            fallocateFile(fs, arg1, atoi(arg2), atoi(arg3));
+        else
+            printf("To use this command: fallocate <filename> [offset] <length>\n");
+    }
+    else if (strcmp(command, "truncate") == 0) {
+        if (n == 3)
+            truncateFile(fs, arg1, atoi(arg2));
+        else
+            printf("To use this command: truncate <filename> <size>\n");
+    }
+    else if (strcmp(command, "snapshot") == 0) {
+        if (n == 2)
+            createSnapshot(fs, arg1);
+        else
+            printf("To use this command: snapshot <name>\n");
+    }
+    else if (strcmp(command, "rmsnapshot") == 0) {
+        if (n == 2)
+            eraseSnapshot(fs, arg1);
+        else
+            printf("To use this command: rmsnapshot <name>\n");
+    }
+    else if (strcmp(command, "snapshots") == 0) {
+        int count = 0;
+        for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+            if (fs->meta->snapshots[i].is_used) {
+                printf("%s\n", fs->meta->snapshots[i].name);
+                count++;
+            }
+        }
+        if (count == 0) printf("No snapshots.\n");
+    }
+    else if (strcmp(command, "mount") == 0) {
+        if (n == 2)
+            mountSnapshot(fs, arg1);
+        else
+            printf("To use this command: mount <snapshot>\n");
+    }
+    else if (strcmp(command, "umount") == 0) {
+        if (fs->read_only)
+            unmountSnapshot(fs);
+        else
+            printf("Error: No snapshot mounted.\n");
+    }
+    else if (strcmp(command, "verify") == 0) {
+        if (n == 2 && strcmp(arg1, "on") == 0) {
+            fs->meta->verify = 1;
+            printf("Checksum verification on read enabled.\n");
+        }
+        else if (n == 2 && strcmp(arg1, "off") == 0) {
+            fs->meta->verify = 0;
+            printf("Checksum verification on read disabled.\n");
+        }
+        else if (n == 1)
+            printf("Checksum verification on read: %s.\n", fs->meta->verify ? "on" : "off");
+        else
+            printf("To use this command: verify [on|off]\n");
+    }
+    else if (strcmp(command, "scrub") == 0) {
+        int bad = verifyFS(fs);
+        printf("Scrub completed: %d corrupted blocks.\n", bad);
+    }
+    else if (strcmp(command, "dedup") == 0) {
+        if (n == 2 && strcmp(arg1, "on") == 0) {
+            fs->meta->dedup = 1;
+            printf("Inline deduplication enabled.\n");
+        }
+        else if (n == 2 && strcmp(arg1, "off") == 0) {
+            fs->meta->dedup = 0;
+            printf("Inline deduplication disabled.\n");
+        }
+        else if (n == 1) {
+            // conta i blocchi risparmiati grazie alla condivisione
+            int used = 0, saved = 0;
+            for (int b = POOL_START; b < POOL_END; b++) {
+                if (fs->meta->ref_count[b] > 0) {
+                    used++;
+                    saved += fs->meta->ref_count[b] - 1;
+                }
+            }
+            printf("Deduplication %s: %d data blocks in use, %d blocks saved.\n", fs->meta->dedup ? "on" : "off", used, saved);
+        }
+        else
+            printf("To use this command: dedup [on|off]\n");
+    }
+    else if (strcmp(command, "du") == 0) {
+        if (n <= 2)
+            diskUsage(fs, n == 2 ? arg1 : NULL);
+        else
+            printf("To use this command: du [name]\n");
+    }
+    else if (strcmp(command, "find") == 0) {
+        if (n == 2)
+            findEntries(fs, arg1);
+        else
+            printf("To use this command: find <pattern>\n");
+    }
     else if (strcmp(command, "ls") == 0)
         listDir(fs);
     else if (strcmp(command, "cd") == 0) {
@@ -608,7 +1868,7 @@ void processCommand(FileSystem *fs, const char *input) {
     }
     else if (strcmp(command, "close") == 0) {
         if (current_open_file.index != -1) {
-            closeFile(&current_open_file);
+            closeFile(fs, &current_open_file);
         } else {
             printf("Error: No file opened to close.\n");
         }
@@ -663,6 +1923,10 @@ void processCommand(FileSystem *fs, const char *input) {
     }
     else
         printf("Command unkown or not implemented yet.\n");
+
+    // anche con uno snapshot montato: i checksum riguardano sempre l'immagine attiva, e verify/dedup
+    // modificano i metadati dei blocchi
+    syncChecksums(fs);
 }
 
 // main program
@@ -690,27 +1954,25 @@ int main() {
     }
 
     // inizializza struttura del file system
-    // il layout della memoria sul buffer è definito in questo ordine: tabella FAT, root directory e blocchi di dati
+    // il layout della memoria sul buffer è definito in questo ordine: tabella FAT, root directory e blocchi di dati, con i metadati dei blocchi in coda
     fs.fs_fd = fs_fd;
-    fs.fat = (FATEntry *)(fs.buffer_fs);
-    fs.root = (FileEntry *)(fs.buffer_fs + (FAT_ENTRIES * sizeof(FATEntry)));
-    fs.current_dir = fs.root;
-
-    int root_block = (FAT_ENTRIES * sizeof(FATEntry)) / BLOCK_SIZE;
-
-    // inizializza FAT e root directory
-    memset(fs.fat, 0, FAT_ENTRIES * sizeof(FATEntry));
-    memset(fs.root, 0, MAX_FILES * sizeof(FileEntry));
-
-    fs.root[0].is_used = 1;
-    fs.root[0].is_directory = 1;
-    strcpy(fs.root[0].name, "/");
-    fs.root[0].start_block = 1;
-    fs.fat[0].next_block = FAT_EOF;
-    fs.fat[1].next_block = root_block;
-    fs.fat[root_block].next_block = FAT_EOF;
-    for (int i=3; i < FAT_ENTRIES; i++)
-        fs.fat[i].next_block = FREE_BLOCK;
+    fs.image_fs = fs.buffer_fs;
+    fs.meta = (BlockMeta *)(fs.buffer_fs + META_START * BLOCK_SIZE);
+    fs.read_only = 0;
+    selectView(&fs, fs.image_fs, fs.meta->block_map);
+
+    initChecksums();
+
+    // se l'immagine contiene già un file system valido lo monta (verificando i checksum), altrimenti la formatta
+    if (fs.meta->magic == FS_MAGIC && fs.meta->version == FS_VERSION) {
+        int bad = verifyFS(&fs);
+        if (bad > 0)
+            printf("Warning: %d corrupted blocks found, use 'scrub' to list them again.\n", bad);
+        printf("Mounted existing file system.\n");
+    } else {
+        formatFS(&fs);
+        printf("Formatted new file system.\n");
+    }
 
     char input[128];
     while(1) {